@@ -7,16 +7,51 @@
 #include <vector>
 #include <cassert>
 #include <typeinfo>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <map>
+#include <queue>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <set>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "src/vector3.h"
 #include "src/color.h"
 #include "src/ray.h"
+#include "src/texture.h"
 #include "src/shape.h"
 #include "src/light.h"
 #include "src/scene.h"
 #include "src/camera.h"
+#include "src/rasterizer.h"
+#include "src/reprojection.h"
 #include "src/lighting.h"
 #include "src/renderer.h"
 #include "src/io.h"
+#include "src/threadpool.h"
+#include "src/socket.h"
+#include "src/server.h"
+#include "src/distributed.h"
 
 using namespace std;
 
@@ -28,59 +63,65 @@ using namespace std;
 #define INFINITY 1e8
 #endif
 
-void simple_scene() {
-  printf ("Generating Scene ...\n");
-  clock_t t;
-  t = clock();
-
-  int width = 1080;
-  int height = 800;
-  float fov = 30.0;
+// Scene objects live on the heap so the scene can stay resident in server mode
+Scene* build_simple_scene() {
+  Scene *scene = new Scene();
+  scene->backgroundColor = Color();
 
-  Scene scene = Scene();
-  scene.backgroundColor = Color();
+  Triangle *t0 = new Triangle( Vector3(0, -4+1, 0), Vector3(1, -4+-1, 0), Vector3(-1, -4+-1, 0), Color(165, 10, 14), 1.0, 0.5, 0.0, 128.0, 0.0);
+  Triangle *t1 = new Triangle( Vector3(0, 4, -30), Vector3(5, -4, -30), Vector3(-5, -4, -30), Color(165, 10, 14), 1.0, 0.5, 0.0, 128.0, 0.0);
 
-  Triangle t0 = Triangle( Vector3(0, -4+1, 0), Vector3(1, -4+-1, 0), Vector3(-1, -4+-1, 0), Color(165, 10, 14), 1.0, 0.5, 0.0, 128.0, 0.0);
-  Triangle t1 = Triangle( Vector3(0, 4, -30), Vector3(5, -4, -30), Vector3(-5, -4, -30), Color(165, 10, 14), 1.0, 0.5, 0.0, 128.0, 0.0);
+  Sphere *ts0 = new Sphere( Vector3(0, 4, 30), 0.2, Color(255), 0.3, 0.8, 0.5, 128.0, 1.0);
+  Sphere *ts1 = new Sphere( Vector3(5, -4, 30), 0.2, Color(255), 0.3, 0.8, 0.5, 128.0, 1.0);
+  Sphere *ts2 = new Sphere( Vector3(-5, -4, 30), 0.2, Color(255), 0.3, 0.8, 0.5, 128.0, 1.0);
 
-  Sphere ts0 = Sphere( Vector3(0, 4, 30), 0.2, Color(255), 0.3, 0.8, 0.5, 128.0, 1.0);
-  Sphere ts1 = Sphere( Vector3(5, -4, 30), 0.2, Color(255), 0.3, 0.8, 0.5, 128.0, 1.0);
-  Sphere ts2 = Sphere( Vector3(-5, -4, 30), 0.2, Color(255), 0.3, 0.8, 0.5, 128.0, 1.0);
-
-  Sphere s0 = Sphere( Vector3(0, -10004, 20), 10000, Color(51, 51, 51), 0.2, 0.5, 0.0, 128.0, 0.0); // Black - Bottom Surface
-  Sphere s1 = Sphere( Vector3(0, 0, 20), 4, Color(165, 10, 14), 0.3, 0.8, 0.5, 128.0, 0.05, 0.95); // Clear
-  s1.glossy_transparency = 0.02;
-  s1.glossiness = 0.05;
-  Sphere s2 = Sphere( Vector3(5, -1, 15), 2, Color(235, 179, 41), 0.4, 0.6, 0.4, 128.0, 1.0); // Yellow
-  s2.glossiness = 0.2;
-  Sphere s3 = Sphere( Vector3(5, 0, 25), 3, Color(6, 72, 111), 0.3, 0.8, 0.1, 128.0, 1.0);  // Blue
-  s3.glossiness = 0.4;
-  Sphere s4 = Sphere( Vector3(-3.5, -1, 10), 2, Color(8, 88, 56), 0.4, 0.6, 0.5, 64.0, 1.0); // Green
-  s4.glossiness = 0.3;
-  Sphere s5 = Sphere( Vector3(-5.5, 0, 15), 3, Color(51, 51, 51), 0.3, 0.8, 0.25, 32.0, 0.0); // Black
+  Sphere *s0 = new Sphere( Vector3(0, -10004, 20), 10000, Color(51, 51, 51), 0.2, 0.5, 0.0, 128.0, 0.0); // Black - Bottom Surface
+  Sphere *s1 = new Sphere( Vector3(0, 0, 20), 4, Color(165, 10, 14), 0.3, 0.8, 0.5, 128.0, 0.05, 0.95); // Clear
+  s1->glossy_transparency = 0.02;
+  s1->glossiness = 0.05;
+  Sphere *s2 = new Sphere( Vector3(5, -1, 15), 2, Color(235, 179, 41), 0.4, 0.6, 0.4, 128.0, 1.0); // Yellow
+  s2->glossiness = 0.2;
+  Sphere *s3 = new Sphere( Vector3(5, 0, 25), 3, Color(6, 72, 111), 0.3, 0.8, 0.1, 128.0, 1.0);  // Blue
+  s3->glossiness = 0.4;
+  Sphere *s4 = new Sphere( Vector3(-3.5, -1, 10), 2, Color(8, 88, 56), 0.4, 0.6, 0.5, 64.0, 1.0); // Green
+  s4->glossiness = 0.3;
+  Sphere *s5 = new Sphere( Vector3(-5.5, 0, 15), 3, Color(51, 51, 51), 0.3, 0.8, 0.25, 32.0, 0.0); // Black
 
   // Add spheres to scene
-  scene.addObject( &t0 );  
-  scene.addObject( &t1 ); 
-  scene.addObject( &ts0 );
-  scene.addObject( &ts1 );
-  scene.addObject( &ts2 );
+  scene->addObject( t0 );  
+  scene->addObject( t1 ); 
+  scene->addObject( ts0 );
+  scene->addObject( ts1 );
+  scene->addObject( ts2 );
   
-  scene.addObject( &s0 );
-  scene.addObject( &s1 );  // Red
-  scene.addObject( &s2 );  // Yellow
-  scene.addObject( &s3 );  // Blue
-  scene.addObject( &s4 );  // Green
-  scene.addObject( &s5 );  // Black
+  scene->addObject( s0 );
+  scene->addObject( s1 );  // Red
+  scene->addObject( s2 );  // Yellow
+  scene->addObject( s3 );  // Blue
+  scene->addObject( s4 );  // Green
+  scene->addObject( s5 );  // Black
   
   // Add light to scene
-  scene.addAmbientLight ( AmbientLight( Vector3(1.0) ) );
+  scene->addAmbientLight ( AmbientLight( Vector3(1.0) ) );
   //DirectionalLight l0 = DirectionalLight( Vector3(0, 20, 35), Vector3(1.4) );
   //PointLight l1 = PointLight( Vector3(20, 20, 35), Vector3(1000.0) );  
-  AreaLight l0 = AreaLight( Vector3(0, 20, 35), Vector3(1.4) );
-  AreaLight l1 = AreaLight( Vector3(20, 20, 35), Vector3(1.8) );
-  scene.addLight( &l0 );
-  scene.addLight( &l1 );
+  AreaLight *l0 = new AreaLight( Vector3(0, 20, 35), Vector3(1.4) );
+  AreaLight *l1 = new AreaLight( Vector3(20, 20, 35), Vector3(1.8) );
+  scene->addLight( l0 );
+  scene->addLight( l1 );
+
+  return scene;
+}
+
+void simple_scene() {
+  printf ("Generating Scene ...\n");
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  int width = 1080;
+  int height = 800;
+  float fov = 30.0;
+
+  Scene *scene = build_simple_scene();
 
   // Add camera
   //Camera camera = Camera( Vector3(0,0,0), width, height, fov);
@@ -89,15 +130,221 @@ void simple_scene() {
   camera.angleX = 30 * M_PI/ 180.0;
 
   // Create Renderer
-  Renderer r = Renderer(width, height, scene, camera);
+  Renderer r = Renderer(width, height, *scene, camera);
   //r.render();
-  r.render_distributed_rays();
+  //r.render_distributed_rays();
+  r.render_hybrid();
+
+  float elapsed = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+  printf ("Scene Complete. Time ellpased: %.2f seconds.\n", elapsed);
+}
+
+// Orbit the simple_scene camera in small steps, re-rendering each frame from the reprojection cache
+void interactive_scene(int frames) {
+  int width = 1080;
+  int height = 800;
+  float fov = 30.0;
+
+  Scene *scene = build_simple_scene();
+  Camera camera = Camera( Vector3(0, 20, -20), width, height, fov);
+  camera.angleX = 30 * M_PI/ 180.0;
+
+  ReprojectionCache cache;
+  Color *image = new Color[width * height];
+
+  for (int frame = 0; frame <= frames; frame++) {
+    if (frame > 0) {
+      camera.position.x += 0.05;
+      camera.angleY += 0.1 * M_PI / 180.0;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Renderer r = Renderer(width, height, *scene, camera);
+    r.render_interactive(cache, image);
+    float elapsed = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+
+    int shaded = cache.reused + cache.retraced;
+    printf ("Frame %d: %.2f seconds, %.1f%% of pixels reprojected\n", frame, elapsed, shaded ? 100.0 * cache.reused / shaded : 0.0);
+    if (frame == frames) r.drawImage(image, width, height);
+  }
+  delete[] image;
+}
+
+// Procedural checker texture written as a tiled, mip-mapped texture file
+bool generate_texture(const char *path, int size, Color a, Color b) {
+  vector<unsigned char> rgb((size_t) size * size * 3);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      bool checker = ((x / 64) + (y / 64)) % 2;
+      float shade = 0.6 + 0.4 * (float) y / size;
+      Color c = (checker ? a : b) * shade;
+      unsigned char *p = &rgb[((size_t) y * size + x) * 3];
+      p[0] = (unsigned char) c.r;
+      p[1] = (unsigned char) c.g;
+      p[2] = (unsigned char) c.b;
+    }
+  }
+  return Texture::write(path, &rgb[0], size, size);
+}
 
-  t = clock() - t;
-  printf ("Scene Complete. Time ellpased: %.2f seconds.\n", ((float)t) / CLOCKS_PER_SEC);
+// simple_scene with image textures on a few spheres, rendered inside a fixed texture memory budget
+void textured_scene(size_t cacheBytes) {
+  printf ("Generating Scene ...\n");
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  int width = 1080;
+  int height = 800;
+  float fov = 30.0;
+
+  struct stat info;
+  if (stat("./checker.rtt", &info) != 0) generate_texture("./checker.rtt", 4096, Color(235, 179, 41), Color(6, 72, 111));
+  if (stat("./tiles.rtt", &info) != 0) generate_texture("./tiles.rtt", 4096, Color(220), Color(165, 10, 14));
+
+  TileCache *cache = new TileCache(cacheBytes);
+  Texture *checker = new Texture(*cache);
+  Texture *tiles = new Texture(*cache);
+  if (!checker->open("./checker.rtt") || !tiles->open("./tiles.rtt")) {
+    printf ("Unable to open textures\n");
+    return;
+  }
+
+  Scene *scene = build_simple_scene();
+  scene->objects[7]->texture = checker;   // Yellow
+  scene->objects[8]->texture = tiles;     // Blue
+  scene->objects[10]->texture = checker;  // Black
+
+  Camera camera = Camera( Vector3(0, 20, -20), width, height, fov);
+  camera.angleX = 30 * M_PI/ 180.0;
+
+  Renderer r = Renderer(width, height, *scene, camera);
+  r.render_hybrid();
+
+  float elapsed = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+  printf ("Scene Complete. Time ellpased: %.2f seconds.\n", elapsed);
+  cache->report();
+}
+
+// Long running server for interactive look-dev, see src/server.h for the protocol
+int render_server(const char *socketPath) {
+  RenderServer server(socketPath);
+  server.addScene("simple", build_simple_scene());
+  if (!server.run()) {
+    printf ("Unable to listen on %s\n", socketPath);
+    return 1;
+  }
+  return 0;
+}
+
+// The simple_scene view, as sent to distributed workers
+FrameSpec simple_frame(int width, int height, int samples) {
+  FrameSpec frame;
+  frame.scene = "simple";
+  frame.width = width;
+  frame.height = height;
+  frame.samples = samples;
+  frame.position = Vector3(0, 20, -20);
+  frame.angleX = 30;
+  frame.angleY = 0;
+  frame.angleZ = 0;
+  frame.fov = 30.0;
+  return frame;
+}
+
+// Hand tiles of the frame to workers that connect on the port and write the merged image
+int render_coordinator(int port, FrameSpec frame) {
+  Coordinator coordinator(port, frame);
+  if (!coordinator.open()) {
+    printf ("Unable to listen on port %d\n", port);
+    return 1;
+  }
+  printf ("Coordinator waiting for workers on port %d ...\n", port);
+  coordinator.run();
+  coordinator.report();
+  IO::RGBToPPMFile(&coordinator.image[0], frame.width, frame.height);
+  return 0;
+}
+
+int render_worker(const char *host, int port, int threads) {
+  map<string, Scene*> scenes;
+  scenes["simple"] = build_simple_scene();
+  TileWorker worker(scenes, threads);
+  if (!worker.run(host, port)) {
+    printf ("Worker unable to render for %s:%d\n", host, port);
+    return 1;
+  }
+  return 0;
+}
+
+// Render the same frame with 1..maxWorkers local single threaded workers and report scaling efficiency
+int distributed_scaling(const char *exe, int port, int maxWorkers, FrameSpec frame) {
+  string portArg = to_string(port);
+  float baseline = 0;
+  printf ("workers  seconds  speedup  efficiency\n");
+
+  for (int n = 1; n <= maxWorkers; n++) {
+    Coordinator coordinator(port, frame);
+    if (!coordinator.open()) {
+      printf ("Unable to listen on port %d\n", port);
+      return 1;
+    }
+
+    vector<pid_t> children;
+    for (int i = 0; i < n; i++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        execl(exe, exe, "worker", "127.0.0.1", portArg.c_str(), "1", (char *) NULL);
+        _exit(1);
+      }
+      children.push_back(pid);
+    }
+
+    coordinator.run();
+    for (int i = 0; i < children.size(); i++)
+      waitpid(children[i], NULL, 0);
+
+    if (n == 1) baseline = coordinator.seconds;
+    float speedup = baseline / coordinator.seconds;
+    printf ("%7d  %7.2f  %7.2f  %9.1f%%\n", n, coordinator.seconds, speedup, 100 * speedup / n);
+  }
+  return 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  string mode = argc > 1 ? argv[1] : "";
+  if (mode == "server")
+    return render_server(argc > 2 ? argv[2] : "/tmp/raytracer.sock");
+
+  if (mode == "coordinator") {
+    int port = argc > 2 ? atoi(argv[2]) : 7878;
+    FrameSpec frame = argc > 5 ? simple_frame(atoi(argv[3]), atoi(argv[4]), atoi(argv[5])) : simple_frame(1080, 800, 16);
+    return render_coordinator(port, frame);
+  }
+  if (mode == "worker" && argc > 2)
+    return render_worker(argv[2], argc > 3 ? atoi(argv[3]) : 7878, argc > 4 ? atoi(argv[4]) : 0);
+  if (mode == "textures") {
+    textured_scene((argc > 2 ? atoi(argv[2]) : 16) * (size_t) 1048576);
+    return 0;
+  }
+  if (mode == "texture" && argc > 3) {
+    vector<unsigned char> rgb;
+    int width, height;
+    if (!IO::PPMFileToRGB(argv[2], rgb, width, height) || !Texture::write(argv[3], &rgb[0], width, height)) {
+      printf ("Unable to convert %s to %s\n", argv[2], argv[3]);
+      return 1;
+    }
+    return 0;
+  }
+  if (mode == "interactive") {
+    interactive_scene(argc > 2 ? atoi(argv[2]) : 4);
+    return 0;
+  }
+  if (mode == "scaling") {
+    int workers = argc > 2 ? atoi(argv[2]) : 4;
+    int port = argc > 3 ? atoi(argv[3]) : 7878;
+    FrameSpec frame = argc > 6 ? simple_frame(atoi(argv[4]), atoi(argv[5]), atoi(argv[6])) : simple_frame(540, 400, 4);
+    return distributed_scaling(argv[0], port, workers, frame);
+  }
+
   simple_scene();
   return 0;
 }
\ No newline at end of file
@@ -31,4 +31,22 @@ class Camera {
       rayDirection.normalize();
       return rayDirection;
     }
+
+    // Angle covered by one pixel, the spread of a primary ray cone
+    float pixelSpread() const { return 2 * angle * invHeight; }
+
+    // Inverse of pixelToViewport - returns false if the point is not in front of the camera
+    bool worldToPixel(const Vector3 &point, float &px, float &py) const {
+      Vector3 view = point - position;
+      view.rotateZ(-angleZ);
+      view.rotateY(-angleY);
+      view.rotateX(-angleX);
+      if (view.z < K_EPSILON) return false;
+
+      float vx = view.x / view.z;
+      float vy = view.y / view.z;
+      px = (vx / (angle * aspectratio) + 1) * 0.5 * width - 0.5;
+      py = (1 - vy / angle) * 0.5 * height - 0.5;
+      return true;
+    }
 };
\ No newline at end of file
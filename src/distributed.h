@@ -0,0 +1,347 @@
+
+// Distributed tile rendering - a coordinator hands frame tiles to worker processes over TCP.
+//
+// Worker -> coordinator:
+//   HELLO <threads>
+//   RESULT <tile> <x0> <y0> <x1> <y1>     followed by (x1 - x0) * (y1 - y0) RGB8 pixels
+// Coordinator -> worker:
+//   JOB <scene> <width> <height> <samples> <px> <py> <pz> <angleX> <angleY> <angleZ> <fov>
+//   TILE <tile> <x0> <y0> <x1> <y1>
+//   QUIT
+// Each worker keeps threads + 1 tiles in flight, so faster workers pull more of the frame. Tiles of a
+// worker that disconnects or stops answering go back to the queue.
+
+#define DIST_TILE_SIZE 64
+#define DIST_WORKER_TIMEOUT 60    // Seconds a busy worker may go without a result
+
+struct FrameSpec {
+  string scene;
+  int width, height, samples;
+  Vector3 position;
+  float angleX, angleY, angleZ, fov;   // Degrees
+
+  string toJob() const {
+    ostringstream job;
+    job << "JOB " << scene << " " << width << " " << height << " " << samples << " "
+        << position.x << " " << position.y << " " << position.z << " "
+        << angleX << " " << angleY << " " << angleZ << " " << fov << "\n";
+    return job.str();
+  }
+
+  bool parse(istringstream &job) {
+    job >> scene >> width >> height >> samples >> position.x >> position.y >> position.z >> angleX >> angleY >> angleZ >> fov;
+    return !job.fail() && width > 0 && height > 0 && samples > 0 && fov > 0;
+  }
+
+  Camera camera() const {
+    Camera camera = Camera(position, width, height, fov);
+    camera.angleX = angleX * M_PI / 180.0;
+    camera.angleY = angleY * M_PI / 180.0;
+    camera.angleZ = angleZ * M_PI / 180.0;
+    return camera;
+  }
+};
+
+// Worker sockets are non-blocking, messages are only parsed once they have fully arrived. A send that would block
+// fails and the worker is dropped at once, its tiles go back to the queue
+struct RemoteWorker {
+  SocketStream stream;
+  int threads;                  // 0 until HELLO arrives
+  int index;                    // Join order, used for reporting
+  set<int> inFlight;
+  chrono::steady_clock::time_point lastResult;
+  int tile, x0, y0, x1, y1;     // RESULT header whose pixels are still arriving
+  size_t owed;                  // Payload bytes of that RESULT not yet received, 0 while waiting for a header
+
+  RemoteWorker(int fd) : stream(fd), threads(0), index(-1), lastResult(chrono::steady_clock::now()), tile(-1), owed(0) {
+    stream.setNonBlocking();
+  }
+};
+
+class Coordinator {
+  public:
+    FrameSpec frame;
+    int port;
+    vector<unsigned char> image;    // RGB8 framebuffer
+    int workersJoined, workersFailed;
+    float seconds;
+
+    Coordinator(int _port, const FrameSpec &_frame) : frame(_frame), port(_port), workersJoined(0), workersFailed(0), seconds(0), listenFd(-1) {
+      tilesX = (frame.width + DIST_TILE_SIZE - 1) / DIST_TILE_SIZE;
+      tilesY = (frame.height + DIST_TILE_SIZE - 1) / DIST_TILE_SIZE;
+    }
+
+    ~Coordinator() { if (listenFd >= 0) close(listenFd); }
+
+    // Start accepting workers - returns false if the port can't be opened
+    bool open() {
+      if (listenFd >= 0) return true;
+      // Close on exec so locally spawned workers don't inherit the port
+      listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (listenFd < 0) return false;
+      int reuse = 1;
+      setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+      sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = htons(port);
+      if (bind(listenFd, (sockaddr *) &address, sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+      }
+      return true;
+    }
+
+    // Render the frame with whichever workers connect - returns false if the port can't be opened
+    bool run() {
+      if (!open()) return false;
+
+      image.assign((size_t) frame.width * frame.height * 3, 0);
+      pending.clear();
+      for (int tile = 0; tile < tilesX * tilesY; tile++)
+        pending.push_back(tile);
+      done.assign(tilesX * tilesY, false);
+      remaining = tilesX * tilesY;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+      while (remaining > 0) {
+        vector<pollfd> fds(1);
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < workers.size(); i++) {
+          pollfd p = { workers[i]->stream.fd, POLLIN, 0 };
+          fds.push_back(p);
+        }
+        poll(&fds[0], fds.size(), 1000);
+
+        if (fds[0].revents & POLLIN) {
+          int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+          if (fd >= 0) {
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            workers.push_back(new RemoteWorker(fd));
+          }
+        }
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        for (int i = fds.size() - 2; i >= 0; i--) {
+          RemoteWorker *worker = workers[i];
+          bool alive = true;
+          if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) alive = receive(*worker);
+          // Partial results don't count as progress, a worker that stalls mid RESULT times out like an idle one
+          bool busy = !worker->inFlight.empty() || worker->owed > 0;
+          if (alive && busy && chrono::duration<float>(now - worker->lastResult).count() > DIST_WORKER_TIMEOUT)
+            alive = false;
+
+          if (alive) alive = dispatch(*worker);
+          if (!alive) drop(i);
+        }
+      }
+      seconds = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+
+      for (int i = 0; i < workers.size(); i++) {
+        workers[i]->stream.sendAll("QUIT\n");
+        delete workers[i];
+      }
+      workers.clear();
+      close(listenFd);
+      listenFd = -1;
+      return true;
+    }
+
+    void report() {
+      printf("Rendered %d tiles in %.2f seconds, %d workers joined, %d failed\n", tilesX * tilesY, seconds, workersJoined, workersFailed);
+      for (int i = 0; i < completedTiles.size(); i++)
+        printf("  worker %d: %d tiles\n", i, completedTiles[i]);
+    }
+
+  private:
+    int listenFd;
+    int tilesX, tilesY, remaining;
+    deque<int> pending;
+    vector<bool> done;
+    vector<RemoteWorker*> workers;
+    vector<int> completedTiles;     // Per joined worker, in join order
+
+    // Read what the worker has sent so far and handle every complete message - false drops the worker
+    bool receive(RemoteWorker &worker) {
+      bool open = worker.stream.receiveAvailable();
+      while (true) {
+        if (worker.owed > 0) {
+          vector<unsigned char> rgb(worker.owed);
+          if (!worker.stream.takeBytes(&rgb[0], rgb.size())) break;
+          worker.owed = 0;
+          storeResult(worker, rgb);
+          continue;
+        }
+
+        string line;
+        if (!worker.stream.takeLine(line)) break;
+        if (!handleMessage(worker, line)) return false;
+      }
+      return open;
+    }
+
+    bool handleMessage(RemoteWorker &worker, const string &line) {
+      istringstream message(line);
+      string command;
+      message >> command;
+      if (command == "HELLO") {
+        message >> worker.threads;
+        if (message.fail() || worker.threads <= 0) return false;
+        worker.index = workersJoined++;
+        completedTiles.push_back(0);
+        return worker.stream.sendAll(frame.toJob());
+      }
+      if (command != "RESULT" || worker.threads == 0) return false;
+
+      int tile, x0, y0, x1, y1;
+      message >> tile >> x0 >> y0 >> x1 >> y1;
+      if (message.fail() || tile < 0 || tile >= tilesX * tilesY) return false;
+      int tx0, ty0, tx1, ty1;
+      tileBounds(tile, tx0, ty0, tx1, ty1);
+      if (x0 != tx0 || y0 != ty0 || x1 != tx1 || y1 != ty1) return false;
+
+      worker.tile = tile;
+      worker.x0 = x0; worker.y0 = y0;
+      worker.x1 = x1; worker.y1 = y1;
+      worker.owed = (x1 - x0) * (y1 - y0) * 3;
+      return true;
+    }
+
+    void storeResult(RemoteWorker &worker, const vector<unsigned char> &rgb) {
+      int tile = worker.tile, x0 = worker.x0, y0 = worker.y0, x1 = worker.x1, y1 = worker.y1;
+      worker.inFlight.erase(tile);
+      worker.lastResult = chrono::steady_clock::now();
+      // A reassigned tile can come back twice, the first copy wins
+      if (done[tile]) return;
+
+      for (int y = y0; y < y1; y++)
+        memcpy(&image[((size_t) y * frame.width + x0) * 3], &rgb[(y - y0) * (x1 - x0) * 3], (x1 - x0) * 3);
+      done[tile] = true;
+      remaining--;
+      completedTiles[worker.index]++;
+    }
+
+    // Top the worker up to threads + 1 tiles - false if a send failed, a partly written line can't be resumed
+    bool dispatch(RemoteWorker &worker) {
+      if (worker.threads == 0) return true;
+      if (worker.inFlight.empty()) worker.lastResult = chrono::steady_clock::now();
+
+      while (worker.inFlight.size() < worker.threads + 1 && !pending.empty()) {
+        int tile = pending.front();
+        pending.pop_front();
+        if (done[tile]) continue;
+
+        int x0, y0, x1, y1;
+        tileBounds(tile, x0, y0, x1, y1);
+        char message[128];
+        snprintf(message, sizeof(message), "TILE %d %d %d %d %d\n", tile, x0, y0, x1, y1);
+        worker.inFlight.insert(tile);
+        if (!worker.stream.sendAll(message)) return false;
+      }
+      return true;
+    }
+
+    // Hand the worker's tiles back to the front of the queue
+    void drop(int i) {
+      RemoteWorker *worker = workers[i];
+      for (set<int>::reverse_iterator it = worker->inFlight.rbegin(); it != worker->inFlight.rend(); ++it)
+        if (!done[*it]) pending.push_front(*it);
+      if (worker->threads > 0) {
+        workersFailed++;
+        printf("Worker %d failed, %d tiles reassigned\n", worker->index, (int) worker->inFlight.size());
+      }
+      workers.erase(workers.begin() + i);
+      delete worker;
+    }
+
+    void tileBounds(int tile, int &x0, int &y0, int &x1, int &y1) {
+      x0 = (tile % tilesX) * DIST_TILE_SIZE;
+      y0 = (tile / tilesX) * DIST_TILE_SIZE;
+      x1 = min(frame.width, x0 + DIST_TILE_SIZE);
+      y1 = min(frame.height, y0 + DIST_TILE_SIZE);
+    }
+};
+
+class TileWorker {
+  public:
+    map<string, Scene*> &scenes;
+    int threads;
+
+    TileWorker(map<string, Scene*> &_scenes, int _threads = 0) : scenes(_scenes), threads(_threads) {
+      if (threads <= 0) threads = max(1, (int) thread::hardware_concurrency());
+    }
+
+    // Render tiles for a coordinator until it sends QUIT - returns false if the job can't be run
+    bool run(const string &host, int port) {
+      int fd = connectTo(host, port);
+      if (fd < 0) return false;
+      SocketStream stream(fd);
+      mutex sendMutex;
+
+      string line;
+      if (!stream.sendAll("HELLO " + to_string(threads) + "\n") || !stream.readLine(line)) return false;
+
+      istringstream job(line);
+      string command;
+      FrameSpec frame;
+      job >> command;
+      if (command != "JOB" || !frame.parse(job) || scenes.find(frame.scene) == scenes.end()) return false;
+
+      Renderer renderer(frame.width, frame.height, *scenes[frame.scene], frame.camera());
+      Rasterizer rasterizer(renderer.scene, renderer.camera);
+      rasterizer.bin();
+
+      atomic<bool> stopping(false);
+      ThreadPool pool(threads);
+      while (stream.readLine(line)) {
+        istringstream message(line);
+        message >> command;
+        if (command == "QUIT") break;
+
+        int tile, x0, y0, x1, y1;
+        message >> tile >> x0 >> y0 >> x1 >> y1;
+        if (command != "TILE" || message.fail()) break;
+
+        pool.submit(tile, 0, [&, tile, x0, y0, x1, y1]() {
+          if (stopping) return;
+          vector<unsigned char> rgb((x1 - x0) * (y1 - y0) * 3);
+          renderer.renderRegion(rasterizer, x0, y0, x1, y1, frame.samples, &rgb[0]);
+
+          char header[128];
+          snprintf(header, sizeof(header), "RESULT %d %d %d %d %d\n", tile, x0, y0, x1, y1);
+          lock_guard<mutex> lock(sendMutex);
+          if (stream.sendAll(header)) stream.sendAll(&rgb[0], rgb.size());
+        });
+      }
+
+      // Coordinator is done with us - skip whatever is still queued
+      stopping = true;
+      return true;
+    }
+
+  private:
+    int connectTo(const string &host, int port) {
+      addrinfo hints, *result;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+      if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0) return -1;
+
+      int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+      if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+      }
+      freeaddrinfo(result);
+      if (fd >= 0) {
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+      }
+      return fd;
+    }
+};
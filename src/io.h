@@ -12,4 +12,24 @@ class IO {
       }
       out.close();
     } 
+
+    static void RGBToPPMFile(const unsigned char* rgb, int width, int height) {
+      ofstream out("./scene.ppm", std::ios::out | std::ios::binary);
+      out << "P6\n" << width << " " << height << "\n255\n";
+      out.write((const char *) rgb, (size_t) width * height * 3);
+      out.close();
+    }
+
+    // Read a binary (P6) 8-bit PPM file
+    static bool PPMFileToRGB(const char *path, vector<unsigned char> &rgb, int &width, int &height) {
+      ifstream in(path, std::ios::in | std::ios::binary);
+      string magic;
+      int maxValue;
+      in >> magic >> width >> height >> maxValue;
+      if (!in || magic != "P6" || maxValue != 255 || width <= 0 || height <= 0) return false;
+      in.get();
+      rgb.resize((size_t) width * height * 3);
+      in.read((char *) &rgb[0], rgb.size());
+      return (size_t) in.gcount() == rgb.size();
+    }
 };
\ No newline at end of file
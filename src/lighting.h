@@ -11,7 +11,7 @@ class Lighting {
         bool isInShadow = getShadow(point, *lights[i], objects);
         
         if (!isInShadow)
-          rayColor +=  getLighting(object, point, normal, view, lights[i]);
+          rayColor +=  getLighting(object, object.color, point, normal, view, lights[i]);
         //else
         //  rayColor += Color(0);
       }
@@ -19,14 +19,15 @@ class Lighting {
       return rayColor;
     }
 
-    static Color getLighting(const Shape &object, const Vector3 &point, const Vector3 &normal, const Vector3 &view, const vector<Light*> &lights, const vector<Shape*> &objects) {
-      Color ambient = object.color;
+    // albedo is the surface color at the hit - object.color, or its texture when it has one
+    static Color getLighting(const Shape &object, const Color &albedo, const Vector3 &point, const Vector3 &normal, const Vector3 &view, const vector<Light*> &lights, const vector<Shape*> &objects) {
+      Color ambient = albedo;
       Color rayColor = ambient * object.ka;
 
       // Compute illumination with shadows
       for(int i = 0; i < lights.size(); i++) {
         float shadowFactor = getShadowFactor(point, *lights[i], objects);
-        rayColor += getLighting(object, point, normal, view, lights[i]) * (1.0 - shadowFactor);
+        rayColor += getLighting(object, albedo, point, normal, view, lights[i]) * (1.0 - shadowFactor);
       }
 
       return rayColor;
@@ -93,10 +94,32 @@ class Lighting {
       
     }
 
-    static Color getLighting(const Shape &object, const Vector3 &point, const Vector3 &normal, const Vector3 &view, const Light *light) {
+    static Color getLighting(const Shape &object, const Color &albedo, const Vector3 &point, const Vector3 &normal, const Vector3 &view, const Light *light) {
+      return getDiffuse(albedo, point, normal, light) * object.kd + getSpecular(object, point, normal, view, light) * object.ks;
+    }
+
+    // View independent part of getLighting - ambient plus shadowed diffuse, shadow factors are written per light
+    static Color getDiffuseLighting(const Shape &object, const Color &albedo, const Vector3 &point, const Vector3 &normal, const vector<Light*> &lights, const vector<Shape*> &objects, float *shadowFactors) {
+      Color ambient = albedo;
+      Color rayColor = ambient * object.ka;
+
+      for(int i = 0; i < lights.size(); i++) {
+        shadowFactors[i] = getShadowFactor(point, *lights[i], objects);
+        rayColor += getDiffuse(albedo, point, normal, lights[i]) * object.kd * (1.0 - shadowFactors[i]);
+      }
+
+      return rayColor;
+    }
+
+    // View dependent part of getLighting, using shadow factors from getDiffuseLighting
+    static Color getSpecularLighting(const Shape &object, const Vector3 &point, const Vector3 &normal, const Vector3 &view, const vector<Light*> &lights, const float *shadowFactors) {
       Color rayColor;
+      for(int i = 0; i < lights.size(); i++)
+        rayColor += getSpecular(object, point, normal, view, lights[i]) * object.ks * (1.0 - shadowFactors[i]);
+      return rayColor;
+    }
 
-      // Create diffuse color
+    static Color getDiffuse(const Color &albedo, const Vector3 &point, const Vector3 &normal, const Light *light) {
       Vector3 N = normal;
       
       Vector3 L = light->position - point;
@@ -106,9 +129,17 @@ class Lighting {
 
       float NdotL = N.dot(L);
       float intensity = max(0.0f, NdotL); 
-      Color diffuse = object.color * light->intensity * intensity * attenuate;
-      
-      // Create specular color
+      return albedo * light->intensity * intensity * attenuate;
+    }
+
+    static Color getSpecular(const Shape &object, const Vector3 &point, const Vector3 &normal, const Vector3 &view, const Light *light) {
+      Vector3 N = normal;
+
+      Vector3 L = light->position - point;
+      float distance = L.length();
+      L.normalize();
+      float attenuate = light->attenuate(distance);
+
       Vector3 V = view;
       Vector3 H = L + V;
       H.normalize();
@@ -116,10 +147,6 @@ class Lighting {
       float shinniness = object.shininess;
       float NdotH = N.dot(H);
       float specularIntensity = pow( max(0.0f, NdotH), shinniness );
-      Color specular = object.color_specular * light->intensity * specularIntensity * attenuate;
-
-      rayColor = diffuse * object.kd + specular * object.ks;   
-
-      return rayColor;
+      return object.color_specular * light->intensity * specularIntensity * attenuate;
     }
 };
\ No newline at end of file
@@ -0,0 +1,209 @@
+
+#define TILE_SIZE 16
+
+#define EDGE_MARGIN 0.05          // Pixels a sample may sit outside a triangle edge and still be tested exactly
+
+struct ScreenQuad {
+  float x0, y0, x1, y1;     // Bounds in the pixel space used by Camera::pixelToViewport
+  bool edges;               // Triangle with edge functions below, inside where all three are >= -EDGE_MARGIN
+  float a[3], b[3], c[3];   // a * x + b * y + c, normalized to pixels of distance from the edge
+
+  bool covers(float x, float y) const {
+    if (x < x0 || x > x1 || y < y0 || y > y1) return false;
+    if (!edges) return true;
+    for (int e = 0; e < 3; e++)
+      if (a[e] * x + b[e] * y + c[e] < -EDGE_MARGIN) return false;
+    return true;
+  }
+};
+
+// Visibility buffer for one tile - primitive id and depth for every jittered sample
+struct GBuffer {
+  int x0, y0, x1, y1;       // Pixel bounds of the tile [x0, x1) x [y0, y1)
+  int samples;              // Samples per pixel
+  vector<float> sampleX, sampleY;
+  vector<Vector3> direction;
+  vector<int> primitive;    // Index into scene.objects, -1 for background
+  vector<float> depth;
+
+  int index(int x, int y, int s) const { return ((y - y0) * (x1 - x0) + (x - x0)) * samples + s; }
+};
+
+class Rasterizer {
+  public:
+    Scene &scene;
+    Camera &camera;
+    int tilesX, tilesY;
+    vector<ScreenQuad> quads;       // Screen-space quad for each object
+    vector< vector<int> > bins;     // Objects overlapping each tile, in scene order
+    Vector3 right, up, forward;     // Camera basis, so sample directions skip the per-ray trig
+    bool jitter;                    // Jitter samples inside the pixel, otherwise sample as Renderer::render does
+
+    Rasterizer(Scene &_scene, Camera &_camera) : scene(_scene), camera(_camera), jitter(true) {
+      tilesX = (camera.width + TILE_SIZE - 1) / TILE_SIZE;
+      tilesY = (camera.height + TILE_SIZE - 1) / TILE_SIZE;
+      right = rotate(Vector3(1, 0, 0)) * (camera.angle * camera.aspectratio);
+      up = rotate(Vector3(0, 1, 0)) * camera.angle;
+      forward = rotate(Vector3(0, 0, 1));
+    }
+
+    int tileCount() const { return tilesX * tilesY; }
+
+    // Project every object to a conservative screen-space quad and bin it into the tiles it covers
+    void bin() {
+      quads.assign(scene.objects.size(), ScreenQuad());
+      bins.assign(tileCount(), vector<int>());
+
+      for (int i = 0; i < scene.objects.size(); i++) {
+        ScreenQuad &q = quads[i];
+        if (!project(*scene.objects[i], q)) continue;
+
+        // Pixel x owns samples in [x, x + 1]
+        int px0 = (int) max(0.0f, ceil(max(q.x0, -1.0f) - 1));
+        int py0 = (int) max(0.0f, ceil(max(q.y0, -1.0f) - 1));
+        int px1 = (int) min(camera.width - 1.0f, floor(min(q.x1, (float) camera.width)));
+        int py1 = (int) min(camera.height - 1.0f, floor(min(q.y1, (float) camera.height)));
+        if (px0 > px1 || py0 > py1) continue;
+
+        for (int ty = py0 / TILE_SIZE; ty <= py1 / TILE_SIZE; ty++)
+          for (int tx = px0 / TILE_SIZE; tx <= px1 / TILE_SIZE; tx++)
+            bins[ty * tilesX + tx].push_back(i);
+      }
+    }
+
+    // Fill the visibility buffer of a tile with the nearest object for each jittered sample
+    void rasterizeTile(int tile, int samples, GBuffer &g) {
+      rasterizeTile(tile, 0, 0, camera.width, camera.height, samples, g);
+    }
+
+    // Same, clipped to the region [rx0, rx1) x [ry0, ry1)
+    void rasterizeTile(int tile, int rx0, int ry0, int rx1, int ry1, int samples, GBuffer &g) {
+      g.x0 = max(rx0, (tile % tilesX) * TILE_SIZE);
+      g.y0 = max(ry0, (tile / tilesX) * TILE_SIZE);
+      g.x1 = min(min(rx1, camera.width), (tile % tilesX + 1) * TILE_SIZE);
+      g.y1 = min(min(ry1, camera.height), (tile / tilesX + 1) * TILE_SIZE);
+      g.x1 = max(g.x0, g.x1);
+      g.y1 = max(g.y0, g.y1);
+      g.samples = samples;
+
+      int count = (g.x1 - g.x0) * (g.y1 - g.y0) * samples;
+      g.sampleX.resize(count);
+      g.sampleY.resize(count);
+      g.direction.resize(count);
+      g.primitive.assign(count, -1);
+      g.depth.assign(count, INFINITY);
+
+      for (int y = g.y0; y < g.y1; y++) {
+        for (int x = g.x0; x < g.x1; x++) {
+          for (int s = 0; s < samples; s++) {
+            int i = g.index(x, y, s);
+            Vector3 r = jitter ? Vector3::random() : Vector3();
+            g.sampleX[i] = x + r.x;
+            g.sampleY[i] = y + r.y;
+            // Same mapping as Camera::pixelToViewport
+            float vx = 2 * ((g.sampleX[i] + 0.5) * camera.invWidth) - 1;
+            float vy = 1 - 2 * ((g.sampleY[i] + 0.5) * camera.invHeight);
+            g.direction[i] = (right * vx + up * vy + forward).normalize();
+          }
+        }
+      }
+
+      const vector<int> &objects = bins[tile];
+      for (int k = 0; k < objects.size(); k++) {
+        const ScreenQuad &q = quads[objects[k]];
+        Shape *object = scene.objects[objects[k]];
+
+        // Only the pixels of the tile the quad overlaps, pixel x owns samples in [x, x + 1]
+        int px0 = max(g.x0, (int) ceil(max(q.x0, -1.0f) - 1));
+        int py0 = max(g.y0, (int) ceil(max(q.y0, -1.0f) - 1));
+        int px1 = min(g.x1 - 1, (int) floor(min(q.x1, (float) camera.width)));
+        int py1 = min(g.y1 - 1, (int) floor(min(q.y1, (float) camera.height)));
+
+        for (int y = py0; y <= py1; y++) {
+          for (int x = px0; x <= px1; x++) {
+            for (int s = 0; s < samples; s++) {
+              int i = g.index(x, y, s);
+              // Coverage test in screen space, then analytic depth from the object itself
+              if (!q.covers(g.sampleX[i], g.sampleY[i])) continue;
+
+              Ray ray(camera.position, g.direction[i]);
+              float t0 = INFINITY, t1 = INFINITY;
+              if (object->intersect(ray, t0, t1)) {
+                if (t0 < 0) t0 = t1;
+                if (t0 < g.depth[i]) {
+                  g.depth[i] = t0;
+                  g.primitive[i] = objects[k];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+  private:
+    Vector3 rotate(Vector3 v) {
+      v.rotateX(camera.angleX);
+      v.rotateY(camera.angleY);
+      v.rotateZ(camera.angleZ);
+      return v;
+    }
+
+    // Returns false if the object lies entirely behind the camera
+    bool project(Shape &object, ScreenQuad &q) {
+      Vector3 bmin, bmax;
+      object.getBounds(bmin, bmax);
+      q.x0 = q.y0 = -INFINITY;
+      q.x1 = q.y1 = INFINITY;
+      q.edges = false;
+      if (isinf(bmin.length2()) || isinf(bmax.length2())) return true;
+
+      ScreenQuad p;
+      p.x0 = p.y0 = INFINITY;
+      p.x1 = p.y1 = -INFINITY;
+      int behind = 0;
+      for (int c = 0; c < 8; c++) {
+        Vector3 corner((c & 1) ? bmax.x : bmin.x, (c & 2) ? bmax.y : bmin.y, (c & 4) ? bmax.z : bmin.z);
+        float px, py;
+        if (!camera.worldToPixel(corner, px, py)) {
+          behind++;
+          continue;
+        }
+        p.x0 = min(p.x0, px); p.y0 = min(p.y0, py);
+        p.x1 = max(p.x1, px); p.y1 = max(p.y1, py);
+      }
+      if (behind == 8) return false;
+      if (behind > 0) return true; // Bounds cross the camera plane - cover the whole screen
+
+      // Pad by a pixel to stay conservative under float error
+      q.x0 = p.x0 - 1; q.y0 = p.y0 - 1;
+      q.x1 = p.x1 + 1; q.y1 = p.y1 + 1;
+
+      Vector3 v[3];
+      if (object.getTriangle(v[0], v[1], v[2])) setupEdges(v, q);
+      return true;
+    }
+
+    // Edge functions of a triangle that lies fully in front of the camera
+    void setupEdges(const Vector3 *v, ScreenQuad &q) {
+      float px[3], py[3];
+      for (int i = 0; i < 3; i++)
+        if (!camera.worldToPixel(v[i], px[i], py[i])) return;
+
+      float area = (px[1] - px[0]) * (py[2] - py[0]) - (px[2] - px[0]) * (py[1] - py[0]);
+      if (fabs(area) < K_EPSILON) return;    // Edge on, leave it to the quad
+      float winding = area > 0 ? 1 : -1;
+
+      for (int e = 0; e < 3; e++) {
+        int i = e, j = (e + 1) % 3;
+        float a = py[i] - py[j], b = px[j] - px[i];
+        float length = sqrt(a * a + b * b);
+        if (length < K_EPSILON) return;
+        float scale = winding / length;
+        q.a[e] = a * scale;
+        q.b[e] = b * scale;
+        q.c[e] = -(a * px[i] + b * py[i]) * scale;
+      }
+      q.edges = true;
+    }
+};
@@ -3,5 +3,7 @@ class Ray {
   public:
     Vector3 origin;
     Vector3 direction;
-    Ray(Vector3 _origin, Vector3 _direction) : origin(_origin), direction(_direction) {}
+    float width, spread;    // Ray cone - footprint at the origin and its growth per unit distance, picks texture mip levels
+    Ray(Vector3 _origin, Vector3 _direction) : origin(_origin), direction(_direction), width(0), spread(0) {}
+    Ray(Vector3 _origin, Vector3 _direction, float _width, float _spread) : origin(_origin), direction(_direction), width(_width), spread(_spread) {}
 };
\ No newline at end of file
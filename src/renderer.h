@@ -17,7 +17,7 @@ class Renderer {
         for (int x = 0; x < width; x++, pixel++) {
           // Send a ray through each pixel
           Vector3 rayDirection = camera.pixelToViewport( Vector3(x, y, 1) );
-          Ray ray(camera.position, rayDirection);
+          Ray ray(camera.position, rayDirection, 0, camera.pixelSpread());
           // Sent pixel for traced ray
           *pixel = trace(ray, 0);
         }
@@ -42,7 +42,7 @@ class Renderer {
             // Send a jittered ray through each pixel
             Vector3 rayDirection = camera.pixelToViewport( Vector3(jx, jy, 1) );
 
-            Ray ray(camera.position, rayDirection);
+            Ray ray(camera.position, rayDirection, 0, camera.pixelSpread());
 
             // Sent pixel for traced ray
             *pixel += trace(ray, 0) * inv_samples;
@@ -53,8 +53,152 @@ class Renderer {
       drawImage(image, width, height);
     }
 
-    Color trace(const Ray &ray, const int &depth) {
+    // Hybrid mode - primary visibility comes from the tiled rasterizer, ray tracing starts at shading
+    void render_hybrid() {
+      int samples = 16;
+
+      Color *image = new Color[width * height];
+
+      Rasterizer rasterizer(scene, camera);
+      rasterizer.bin();
+
+      atomic<int> nextTile(0);
+      int threadCount = max(1, (int) thread::hardware_concurrency());
+      vector<thread> threads;
+      vector<float> visibilitySeconds(threadCount), shadingSeconds(threadCount);
+      for (int t = 0; t < threadCount; t++) {
+        threads.push_back(thread([&, t]() {
+          GBuffer gbuffer;
+          Color tile[TILE_SIZE * TILE_SIZE];
+          for (int i = nextTile++; i < rasterizer.tileCount(); i = nextTile++) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            rasterizer.rasterizeTile(i, samples, gbuffer);
+            chrono::steady_clock::time_point rasterized = chrono::steady_clock::now();
+            shadeTile(gbuffer, tile);
+            visibilitySeconds[t] += chrono::duration<float>(rasterized - start).count();
+            shadingSeconds[t] += chrono::duration<float>(chrono::steady_clock::now() - rasterized).count();
+            for (int y = gbuffer.y0; y < gbuffer.y1; y++)
+              for (int x = gbuffer.x0; x < gbuffer.x1; x++)
+                image[y * width + x] = tile[(y - gbuffer.y0) * (gbuffer.x1 - gbuffer.x0) + (x - gbuffer.x0)];
+          }
+        }));
+      }
+      float visibility = 0, shading = 0;
+      for (int t = 0; t < threadCount; t++) {
+        threads[t].join();
+        visibility += visibilitySeconds[t];
+        shading += shadingSeconds[t];
+      }
+      printf ("Primary visibility %.2f seconds, shading %.2f seconds (summed over %d threads)\n", visibility, shading, threadCount);
+
+      drawImage(image, width, height);
+      delete[] image;
+    }
+
+    // Shade a rasterized tile into a row-major buffer of (x1 - x0) * (y1 - y0) pixels
+    void shadeTile(const GBuffer &g, Color *out) {
+      float inv_samples = 1 / (float) g.samples;
+      for (int y = g.y0; y < g.y1; y++) {
+        for (int x = g.x0; x < g.x1; x++) {
+          Color *pixel = out + (y - g.y0) * (g.x1 - g.x0) + (x - g.x0);
+          *pixel = Color();
+          for (int s = 0; s < g.samples; s++) {
+            int i = g.index(x, y, s);
+            if (g.primitive[i] < 0) {
+              *pixel += scene.backgroundColor * inv_samples;
+              continue;
+            }
+            Ray ray(camera.position, g.direction[i], 0, camera.pixelSpread());
+            *pixel += shade(ray, scene.objects[g.primitive[i]], g.depth[i], 0) * inv_samples;
+          }
+        }
+      }
+    }
+
+    // Interactive re-render into image - one sample per pixel, view independent shading is reprojected
+    // from the previous frame in cache wherever that surface point was already visible
+    void render_interactive(ReprojectionCache &cache, Color *image) {
+      Rasterizer rasterizer(scene, camera);
+      rasterizer.jitter = false;
+      rasterizer.bin();
+      cache.beginFrame(camera, scene);
+
+      atomic<int> nextTile(0);
+      int threadCount = max(1, (int) thread::hardware_concurrency());
+      vector<thread> threads;
+      for (int t = 0; t < threadCount; t++) {
+        threads.push_back(thread([&]() {
+          GBuffer gbuffer;
+          for (int i = nextTile++; i < rasterizer.tileCount(); i = nextTile++) {
+            rasterizer.rasterizeTile(i, 1, gbuffer);
+            for (int y = gbuffer.y0; y < gbuffer.y1; y++) {
+              for (int x = gbuffer.x0; x < gbuffer.x1; x++) {
+                int g = gbuffer.index(x, y, 0), pixel = y * width + x;
+                if (gbuffer.primitive[g] < 0) {
+                  cache.store(pixel, -1, Vector3(), Color());
+                  image[pixel] = scene.backgroundColor;
+                  continue;
+                }
+                Ray ray(camera.position, gbuffer.direction[g], 0, camera.pixelSpread());
+                image[pixel] = shadeReprojected(ray, gbuffer.primitive[g], gbuffer.depth[g], cache, pixel);
+              }
+            }
+          }
+        }));
+      }
+      for (int t = 0; t < threadCount; t++)
+        threads[t].join();
+
+      cache.endFrame(camera);
+    }
+
+    Color shadeReprojected(const Ray &ray, int primitive, const float &tnear, ReprojectionCache &cache, int pixel) {
+      Shape *hit = scene.objects[primitive];
+      Vector3 hitPoint = ray.origin + ray.direction * tnear;
+      Vector3 N = hit->getNormal(hitPoint);
+      N.normalize();
+      Vector3 V = camera.position - hitPoint;
+      V.normalize();
+
+      float footprint = ray.width + tnear * ray.spread;
+
       Color rayColor;
+      int previous = cache.lookup(pixel, primitive, hitPoint);
+      if (previous >= 0) {
+        rayColor = cache.reuse(previous, pixel, hitPoint);
+      }
+      else {
+        Color albedo = hit->getColor(hitPoint, footprint);
+        rayColor = Lighting::getDiffuseLighting(*hit, albedo, hitPoint, N, scene.lights, scene.objects, cache.shadows(pixel));
+        cache.store(pixel, primitive, hitPoint, rayColor);
+      }
+      rayColor += Lighting::getSpecularLighting(*hit, hitPoint, N, V, scene.lights, cache.shadows(pixel));
+
+      return shadeSecondary(ray, hit, hitPoint, N, V, rayColor, footprint, 0);
+    }
+
+    // Render the region [x0, x1) x [y0, y1) into a row-major RGB8 buffer
+    void renderRegion(Rasterizer &rasterizer, int x0, int y0, int x1, int y1, int samples, unsigned char *rgb) {
+      GBuffer gbuffer;
+      Color tile[TILE_SIZE * TILE_SIZE];
+      for (int ty = y0 / TILE_SIZE; ty * TILE_SIZE < y1; ty++) {
+        for (int tx = x0 / TILE_SIZE; tx * TILE_SIZE < x1; tx++) {
+          rasterizer.rasterizeTile(ty * rasterizer.tilesX + tx, x0, y0, x1, y1, samples, gbuffer);
+          shadeTile(gbuffer, tile);
+          for (int y = gbuffer.y0; y < gbuffer.y1; y++) {
+            for (int x = gbuffer.x0; x < gbuffer.x1; x++) {
+              Color pixel = tile[(y - gbuffer.y0) * (gbuffer.x1 - gbuffer.x0) + (x - gbuffer.x0)].clamp();
+              unsigned char *out = rgb + ((y - y0) * (x1 - x0) + (x - x0)) * 3;
+              out[0] = (unsigned char) pixel.r;
+              out[1] = (unsigned char) pixel.g;
+              out[2] = (unsigned char) pixel.b;
+            }
+          }
+        }
+      }
+    }
+
+    Color trace(const Ray &ray, const int &depth) {
       float tnear = INFINITY;
       Shape* hit = NULL;
       // Find nearest intersection with ray and objects in scene
@@ -75,14 +219,27 @@ class Renderer {
           return Color();
       }
 
+      return shade(ray, hit, tnear, depth);
+    }
+
+    // Shade a known nearest hit - trace() after visibility has been resolved
+    Color shade(const Ray &ray, Shape *hit, const float &tnear, const int &depth) {
+      Color rayColor;
       Vector3 hitPoint = ray.origin + ray.direction * tnear;
       Vector3 N = hit->getNormal(hitPoint);
       N.normalize();
       Vector3 V = camera.position - hitPoint;
       V.normalize();
 
-      rayColor = Lighting::getLighting(*hit, hitPoint, N, V, scene.lights, scene.objects);
+      float footprint = ray.width + tnear * ray.spread;
+      Color albedo = hit->getColor(hitPoint, footprint);
+      rayColor = Lighting::getLighting(*hit, albedo, hitPoint, N, V, scene.lights, scene.objects);
+
+      return shadeSecondary(ray, hit, hitPoint, N, V, rayColor, footprint, depth);
+    }
 
+    // Combine the local lighting of a hit with its reflection and refraction rays, footprint is the ray cone width at the hit
+    Color shadeSecondary(const Ray &ray, Shape *hit, const Vector3 &hitPoint, Vector3 N, const Vector3 &V, Color rayColor, float footprint, const int &depth) {
       float bias = 1e-4;
       bool inside = false;
       if (ray.direction.dot(N) > 0) N = -N, inside = true;
@@ -93,7 +250,7 @@ class Renderer {
           R = R + Vector3::random() * hit->glossiness;
           R.normalize();
 
-          Ray rRay(hitPoint + N * bias, R);
+          Ray rRay(hitPoint + N * bias, R, footprint, ray.spread);
           float VdotR =  max(0.0f, V.dot(-R));
           Color reflectionColor = trace(rRay,  depth + 1); //* VdotR;
           Color refractionColor = Color();
@@ -110,7 +267,7 @@ class Renderer {
             T = T + Vector3::random() * hit->glossy_transparency;
             T.normalize();
 
-            Ray refractionRay(hitPoint - N * bias, T);
+            Ray refractionRay(hitPoint - N * bias, T, footprint, ray.spread);
             refractionColor = trace(refractionRay, depth + 1);
             rayColor = (reflectionColor * hit->reflectivity) + (refractionColor * hit->transparency);
           }
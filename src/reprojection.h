@@ -0,0 +1,155 @@
+
+#define REPROJECTION_DEPTH_TOLERANCE 0.02   // Relative depth difference still treated as the same surface
+#define REPROJECTION_MAX_AGE 8              // Frames a reprojected entry may be reused before it is re-traced
+
+// Temporal cache for interactive re-renders. Keeps the previous frame's hit points, primitive ids and view
+// independent shading (ambient, shadowed diffuse and per light shadow factors) so that after a small camera
+// move only specular, reflection, refraction and disoccluded pixels need tracing again.
+class ReprojectionCache {
+  public:
+    int width, height, lightCount;
+    atomic<int> reused, retraced;
+
+    ReprojectionCache() : width(0), height(0), lightCount(0), reused(0), retraced(0), valid(false), fov(0), frame(0), previousCamera(Vector3(), 1, 1, 1) {}
+
+    // Start a frame of scene seen through camera - history is only kept if nothing but the camera position and
+    // angles changed since the last frame
+    void beginFrame(const Camera &camera, const Scene &scene) {
+      vector<double> signature = sceneSignature(scene);
+      int lights = scene.lights.size();
+      bool compatible = valid && camera.width == width && camera.height == height && camera.fov == fov &&
+                        lights == lightCount && signature == previousSignature;
+      previousSignature.swap(signature);
+
+      if (compatible) {
+        previous.swap(current);
+      }
+      else {
+        width = camera.width;
+        height = camera.height;
+        fov = camera.fov;
+        lightCount = lights;
+        previous.resize(width * height, lightCount);
+        previous.primitive.assign(width * height, -1);
+      }
+      current.resize(width * height, lightCount);
+      reused = 0;
+      retraced = 0;
+      frame++;
+    }
+
+    void endFrame(const Camera &camera) {
+      previousCamera = camera;
+      valid = true;
+    }
+
+    // Drop all history, for scene edits the signature can't see such as a texture's contents changing
+    void invalidate() { valid = false; }
+
+    // Previous frame pixel that saw the same surface point from pixel, or -1 if it was hidden, off screen or stale
+    int lookup(int pixel, int primitive, const Vector3 &point) const {
+      // Refresh a rolling 1 / REPROJECTION_MAX_AGE of the screen each frame so drift is bounded without a full re-trace
+      if ((frame + pixel) % REPROJECTION_MAX_AGE == 0) return -1;
+
+      float px, py;
+      if (!previousCamera.worldToPixel(point, px, py)) return -1;
+
+      int x = (int) floor(px + 0.5), y = (int) floor(py + 0.5);
+      if (x < 0 || y < 0 || x >= width || y >= height) return -1;
+
+      int i = y * width + x;
+      if (previous.primitive[i] != primitive || previous.age[i] >= REPROJECTION_MAX_AGE) return -1;
+
+      float depth = (point - previousCamera.position).length();
+      float cachedDepth = (previous.hitPoint[i] - previousCamera.position).length();
+      if (fabs(depth - cachedDepth) > REPROJECTION_DEPTH_TOLERANCE * depth) return -1;
+      return i;
+    }
+
+    // Carry a previous entry over to pixel of the current frame, returns its view independent color
+    Color reuse(int previousPixel, int pixel, const Vector3 &point) {
+      current.primitive[pixel] = previous.primitive[previousPixel];
+      current.hitPoint[pixel] = point;
+      current.color[pixel] = previous.color[previousPixel];
+      current.age[pixel] = previous.age[previousPixel] + 1;
+      for (int l = 0; l < lightCount; l++)
+        current.shadow[pixel * lightCount + l] = previous.shadow[previousPixel * lightCount + l];
+      reused++;
+      return current.color[pixel];
+    }
+
+    void store(int pixel, int primitive, const Vector3 &point, const Color &viewIndependent) {
+      current.primitive[pixel] = primitive;
+      current.hitPoint[pixel] = point;
+      current.color[pixel] = viewIndependent;
+      current.age[pixel] = 0;
+      if (primitive >= 0) retraced++;
+    }
+
+    float* shadows(int pixel) { return current.shadow.data() + pixel * lightCount; }
+
+  private:
+    struct Frame {
+      vector<int> primitive;        // -1 for background
+      vector<Vector3> hitPoint;
+      vector<Color> color;          // Ambient plus shadowed diffuse
+      vector<float> shadow;         // lightCount factors per pixel
+      vector<unsigned char> age;
+
+      void resize(int pixels, int lights) {
+        primitive.resize(pixels);
+        hitPoint.resize(pixels);
+        color.resize(pixels);
+        shadow.resize(pixels * lights);
+        age.resize(pixels);
+      }
+
+      void swap(Frame &f) {
+        primitive.swap(f.primitive);
+        hitPoint.swap(f.hitPoint);
+        color.swap(f.color);
+        shadow.swap(f.shadow);
+        age.swap(f.age);
+      }
+    };
+
+    bool valid;
+    vector<double> previousSignature;
+    float fov;
+    int frame;
+    Camera previousCamera;
+    Frame previous, current;
+
+    // Everything the cached view independent shading depends on - lights, materials, geometry and identity of the objects
+    static vector<double> sceneSignature(const Scene &scene) {
+      vector<double> s;
+      const Light &ambient = scene.ambientLight;
+      const Color &background = scene.backgroundColor;
+      double header[] = { ambient.intensity.x, ambient.intensity.y, ambient.intensity.z, background.r, background.g, background.b };
+      s.insert(s.end(), header, header + 6);
+
+      for (int i = 0; i < scene.lights.size(); i++) {
+        const Light &l = *scene.lights[i];
+        double light[] = { (double) (uintptr_t) &l, (double) l.type, l.position.x, l.position.y, l.position.z,
+                           l.intensity.x, l.intensity.y, l.intensity.z, 0, 0, 0 };
+        if (l.type == 0x20) {
+          light[8] = l.samples;
+          light[9] = l.width;
+          light[10] = l.height;
+        }
+        s.insert(s.end(), light, light + 11);
+      }
+
+      for (int i = 0; i < scene.objects.size(); i++) {
+        Shape &o = *scene.objects[i];
+        Vector3 bmin, bmax;
+        o.getBounds(bmin, bmax);
+        double object[] = { (double) (uintptr_t) &o, (double) (uintptr_t) o.texture,
+                            bmin.x, bmin.y, bmin.z, bmax.x, bmax.y, bmax.z, o.center.x, o.center.y, o.center.z,
+                            o.color.r, o.color.g, o.color.b, o.color_specular.r, o.color_specular.g, o.color_specular.b,
+                            o.ka, o.kd, o.ks, o.shininess, o.reflectivity, o.transparency, o.glossiness, o.glossy_transparency };
+        s.insert(s.end(), object, object + 25);
+      }
+      return s;
+    }
+};
@@ -0,0 +1,316 @@
+
+// Persistent render server - scenes stay resident, jobs arrive over a Unix domain socket.
+//
+// Requests are single text lines:
+//   RENDER <id> <scene> <width> <height> <samples> <priority> <x0> <y0> <x1> <y1> <px> <py> <pz> <angleX> <angleY> <angleZ> <fov>
+//   CANCEL <id>
+// Angles and fov are in degrees, the region is [x0, x1) x [y0, y1). Replies are text lines, TILE is followed
+// by (x1 - x0) * (y1 - y0) RGB8 pixels:
+//   TILE <id> <x0> <y0> <x1> <y1>
+//   DONE <id> <tiles> <firstTileMs> <totalMs>
+//   CANCELLED <id>
+//   ERROR <id> <message>
+
+#define SERVER_MAX_DIMENSION 16384   // Largest accepted width or height
+#define SERVER_MAX_SAMPLES 1024
+
+struct RenderJob;
+
+// Replies are queued and written by a per-connection thread so a slow client never stalls the pool
+class Connection {
+  public:
+    SocketStream stream;
+    mutex jobsMutex;
+    map<int, shared_ptr<RenderJob> > jobs;    // Jobs still running, by client job id
+
+    Connection(int fd) : stream(fd), closing(false) {
+      writer = thread([this]() { write(); });
+    }
+
+    ~Connection() {
+      {
+        lock_guard<mutex> lock(outboxMutex);
+        closing = true;
+      }
+      pending.notify_one();
+      writer.join();
+    }
+
+    void send(const string &header, const unsigned char *data = NULL, size_t size = 0) {
+      string message = header;
+      if (data) message.append((const char *) data, size);
+      {
+        lock_guard<mutex> lock(outboxMutex);
+        outbox.push_back(message);
+      }
+      pending.notify_one();
+    }
+
+  private:
+    thread writer;
+    mutex outboxMutex;
+    condition_variable pending;
+    deque<string> outbox;
+    bool closing;
+
+    void write() {
+      bool connected = true;
+      while (true) {
+        string message;
+        {
+          unique_lock<mutex> lock(outboxMutex);
+          pending.wait(lock, [this]() { return closing || !outbox.empty(); });
+          if (outbox.empty()) return;
+          message.swap(outbox.front());
+          outbox.pop_front();
+        }
+        // Keep draining after a failed write so the outbox can't grow without bound
+        if (connected) connected = stream.sendAll(message);
+      }
+    }
+};
+
+struct RenderJob {
+  int id, poolId;
+  int priority, samples;
+  int x0, y0, x1, y1;
+  Renderer renderer;
+  Rasterizer rasterizer;
+  shared_ptr<Connection> connection;
+  vector<int> tiles;            // Rasterizer tiles overlapping the region
+
+  atomic<int> remaining;
+  atomic<int> sent;
+  atomic<bool> cancelled;
+  atomic<bool> failed;          // An ERROR was already sent for this job
+  atomic<bool> started;
+  chrono::steady_clock::time_point received;
+  float firstTileMs;
+
+  RenderJob(int _width, int _height, Scene &_scene, Camera &_camera) :
+    renderer(_width, _height, _scene, _camera), rasterizer(renderer.scene, renderer.camera),
+    remaining(0), sent(0), cancelled(false), failed(false), started(false), firstTileMs(0) {}
+};
+
+class RenderServer {
+  public:
+    string socketPath;
+    map<string, Scene*> scenes;     // Resident for the life of the server
+    ThreadPool pool;
+
+    RenderServer(const string &_socketPath, int threads = 0) : socketPath(_socketPath), pool(threads), nextJob(0) {}
+
+    void addScene(const string &name, Scene *scene) { scenes[name] = scene; }
+
+    // Accept clients until the process is killed - returns false if the socket can't be opened
+    bool run() {
+      int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listenFd < 0) return false;
+
+      sockaddr_un address;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      if (socketPath.size() >= sizeof(address.sun_path)) return false;
+      strcpy(address.sun_path, socketPath.c_str());
+      unlink(socketPath.c_str());
+
+      if (bind(listenFd, (sockaddr *) &address, sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+        close(listenFd);
+        return false;
+      }
+      printf("Render server listening on %s with %d threads\n", socketPath.c_str(), pool.size());
+
+      while (true) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) continue;
+        shared_ptr<Connection> connection = make_shared<Connection>(fd);
+        thread([this, connection]() { serve(connection); }).detach();
+      }
+    }
+
+  private:
+    atomic<int> nextJob;
+
+    void serve(shared_ptr<Connection> connection) {
+      string line;
+      while (connection->stream.readLine(line)) {
+        istringstream request(line);
+        string command;
+        request >> command;
+        // A job that fails to set up is answered with an ERROR, it must never take the server down
+        try {
+          if (command == "RENDER") handleRender(connection, request);
+          else if (command == "CANCEL") handleCancel(connection, request);
+          else connection->send("ERROR -1 unknown command\n");
+        }
+        catch (const exception &e) {
+          connection->send("ERROR " + requestId(line) + " " + e.what() + "\n");
+        }
+      }
+
+      // Client hung up - nobody is left to receive its tiles
+      vector< shared_ptr<RenderJob> > running;
+      {
+        lock_guard<mutex> lock(connection->jobsMutex);
+        for (map<int, shared_ptr<RenderJob> >::iterator it = connection->jobs.begin(); it != connection->jobs.end(); ++it)
+          running.push_back(it->second);
+      }
+      for (int i = 0; i < running.size(); i++)
+        cancelJob(running[i]);
+    }
+
+    void handleRender(shared_ptr<Connection> connection, istringstream &request) {
+      chrono::steady_clock::time_point received = chrono::steady_clock::now();
+      int id = -1, width, height, samples, priority, x0, y0, x1, y1;
+      string sceneName;
+      float px, py, pz, angleX, angleY, angleZ, fov;
+      request >> id >> sceneName >> width >> height >> samples >> priority >> x0 >> y0 >> x1 >> y1
+              >> px >> py >> pz >> angleX >> angleY >> angleZ >> fov;
+      if (request.fail() || width <= 0 || height <= 0 || samples <= 0 || fov <= 0) {
+        connection->send("ERROR " + to_string(id) + " malformed request\n");
+        return;
+      }
+      if (width > SERVER_MAX_DIMENSION || height > SERVER_MAX_DIMENSION || samples > SERVER_MAX_SAMPLES) {
+        connection->send("ERROR " + to_string(id) + " job too large\n");
+        return;
+      }
+      if (scenes.find(sceneName) == scenes.end()) {
+        connection->send("ERROR " + to_string(id) + " unknown scene\n");
+        return;
+      }
+
+      Camera camera = Camera( Vector3(px, py, pz), width, height, fov);
+      camera.angleX = angleX * M_PI / 180.0;
+      camera.angleY = angleY * M_PI / 180.0;
+      camera.angleZ = angleZ * M_PI / 180.0;
+
+      shared_ptr<RenderJob> job = make_shared<RenderJob>(width, height, *scenes[sceneName], camera);
+      job->received = received;
+      job->id = id;
+      job->poolId = nextJob++;
+      job->priority = priority;
+      job->samples = samples;
+      job->x0 = max(0, x0); job->y0 = max(0, y0);
+      job->x1 = min(width, x1); job->y1 = min(height, y1);
+      job->connection = connection;
+      job->rasterizer.bin();
+
+      for (int tile = 0; tile < job->rasterizer.tileCount(); tile++) {
+        int tx = (tile % job->rasterizer.tilesX) * TILE_SIZE, ty = (tile / job->rasterizer.tilesX) * TILE_SIZE;
+        if (tx + TILE_SIZE > job->x0 && tx < job->x1 && ty + TILE_SIZE > job->y0 && ty < job->y1)
+          job->tiles.push_back(tile);
+      }
+      if (job->tiles.empty()) {
+        connection->send("DONE " + to_string(id) + " 0 0 0\n");
+        return;
+      }
+
+      {
+        lock_guard<mutex> lock(connection->jobsMutex);
+        if (connection->jobs.count(id)) {
+          connection->send("ERROR " + to_string(id) + " job id in use\n");
+          return;
+        }
+        connection->jobs[id] = job;
+      }
+
+      job->remaining = job->tiles.size();
+      for (int i = 0; i < job->tiles.size(); i++) {
+        int tile = job->tiles[i];
+        pool.submit(job->poolId, priority, [this, job, tile]() {
+          try {
+            renderTile(*job, tile);
+          }
+          catch (const exception &e) {
+            // Report the first failure in place of DONE and drop the rest of the job
+            if (!job->failed.exchange(true)) {
+              job->connection->send("ERROR " + to_string(job->id) + " " + e.what() + "\n");
+              cancelJob(job);
+            }
+          }
+          if (--job->remaining == 0) finish(*job);
+        });
+      }
+    }
+
+    void handleCancel(shared_ptr<Connection> connection, istringstream &request) {
+      int id = -1;
+      request >> id;
+      shared_ptr<RenderJob> job;
+      {
+        lock_guard<mutex> lock(connection->jobsMutex);
+        map<int, shared_ptr<RenderJob> >::iterator it = connection->jobs.find(id);
+        if (it != connection->jobs.end()) job = it->second;
+      }
+      if (!job) {
+        connection->send("ERROR " + to_string(id) + " no such job\n");
+        return;
+      }
+      cancelJob(job);
+    }
+
+    // Queued tiles are dropped from the pool, tiles already rendering finish normally
+    void cancelJob(shared_ptr<RenderJob> job) {
+      job->cancelled = true;
+      int dropped = pool.cancel(job->poolId);
+      if (dropped > 0 && job->remaining.fetch_sub(dropped) == dropped) finish(*job);
+    }
+
+    void renderTile(RenderJob &job, int tile) {
+      if (job.cancelled) return;
+
+      static thread_local GBuffer gbuffer;
+      Color pixels[TILE_SIZE * TILE_SIZE];
+      unsigned char rgb[TILE_SIZE * TILE_SIZE * 3];
+
+      job.rasterizer.rasterizeTile(tile, job.x0, job.y0, job.x1, job.y1, job.samples, gbuffer);
+      job.renderer.shadeTile(gbuffer, pixels);
+
+      int count = (gbuffer.x1 - gbuffer.x0) * (gbuffer.y1 - gbuffer.y0);
+      for (int i = 0; i < count; i++) {
+        Color pixel = pixels[i].clamp();
+        rgb[i * 3] = (unsigned char) pixel.r;
+        rgb[i * 3 + 1] = (unsigned char) pixel.g;
+        rgb[i * 3 + 2] = (unsigned char) pixel.b;
+      }
+
+      if (!job.started.exchange(true))
+        job.firstTileMs = elapsedMs(job);
+      char header[128];
+      snprintf(header, sizeof(header), "TILE %d %d %d %d %d\n", job.id, gbuffer.x0, gbuffer.y0, gbuffer.x1, gbuffer.y1);
+      job.connection->send(header, rgb, count * 3);
+      job.sent++;
+    }
+
+    void finish(RenderJob &job) {
+      {
+        lock_guard<mutex> lock(job.connection->jobsMutex);
+        job.connection->jobs.erase(job.id);
+      }
+
+      if (job.failed) return;
+
+      char message[128];
+      if (job.cancelled) {
+        snprintf(message, sizeof(message), "CANCELLED %d\n", job.id);
+      }
+      else {
+        snprintf(message, sizeof(message), "DONE %d %d %.2f %.2f\n", job.id, job.sent.load(), job.firstTileMs, elapsedMs(job));
+        printf("Job %d: %d tiles, first tile %.2f ms, total %.2f ms\n", job.id, job.sent.load(), job.firstTileMs, elapsedMs(job));
+      }
+      job.connection->send(message);
+    }
+
+    // Job id of a request line for error replies, -1 if it has none
+    string requestId(const string &line) {
+      istringstream request(line);
+      string command;
+      int id = -1;
+      request >> command >> id;
+      return to_string(request.fail() ? -1 : id);
+    }
+
+    float elapsedMs(const RenderJob &job) {
+      return chrono::duration<float, milli>(chrono::steady_clock::now() - job.received).count();
+    }
+};
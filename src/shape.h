@@ -12,9 +12,22 @@ class Shape {
     float transparency;       // Transparency of material [0, 1]
     float glossiness;         // Strength of glossy reflections
     float glossy_transparency; // Strength of glossy transparency
+    Texture *texture;         // Replaces color when set
+
+    Shape() : texture(NULL) {}
 
     virtual bool intersect(const Ray &ray, float &to, float &t1) { return false; }
     virtual Vector3 getNormal(const Vector3 &hitPoint) { return Vector3(); }
+    virtual void getBounds(Vector3 &bmin, Vector3 &bmax) { bmin = Vector3(-INFINITY); bmax = Vector3(INFINITY); }
+    virtual bool getTriangle(Vector3 &p0, Vector3 &p1, Vector3 &p2) { return false; }  // Vertices of a flat triangle surface
+    virtual Vector3 getUV(const Vector3 &hitPoint) { return Vector3(); }
+    virtual float getUVScale() { return 0; }  // uv units per world unit
+
+    // Diffuse color at a hit, footprint is the ray cone width there in world units
+    Color getColor(const Vector3 &hitPoint, float footprint) {
+      if (!texture) return color;
+      return texture->sample(getUV(hitPoint), footprint * getUVScale());
+    }
 };
 
 class Sphere : public Shape {
@@ -74,6 +87,21 @@ class Sphere : public Shape {
     Vector3 getNormal(const Vector3 &hitPoint) {
       return (hitPoint - center) / radius;
     }
+
+    void getBounds(Vector3 &bmin, Vector3 &bmax) {
+      bmin = center - radius;
+      bmax = center + radius;
+    }
+
+    // Spherical mapping - u around the equator, v from pole to pole
+    Vector3 getUV(const Vector3 &hitPoint) {
+      Vector3 N = getNormal(hitPoint);
+      float u = 0.5 + atan2(N.z, N.x) / (2 * M_PI);
+      float v = 0.5 - asin(max(-1.0f, min(1.0f, N.y))) / M_PI;
+      return Vector3(u, v, 0);
+    }
+
+    float getUVScale() { return 1 / (2 * M_PI * radius); }
 };
 
 class Triangle : public Shape {
@@ -81,12 +109,13 @@ class Triangle : public Shape {
     Vector3 v0;
     Vector3 v1;
     Vector3 v2;
+    Vector3 uv0, uv1, uv2;    // Texture coordinates of each vertex
 
     Triangle(
       const Vector3 &_v0, const Vector3 &_v1, const Vector3 &_v2, const Color &_color, 
       const float _ka, const float _kd, const float _ks, const float _shinny = 128.0, 
       const float _reflectScale = 1.0, const float _transparency = 0.0) :
-      v0(_v0), v1(_v1), v2(_v2)
+      v0(_v0), v1(_v1), v2(_v2), uv0(0, 0, 0), uv1(1, 0, 0), uv2(0, 1, 0)
       {
         color = _color;
         color_specular = Color(255);
@@ -182,4 +211,38 @@ class Triangle : public Shape {
       N.normalize(); 
       return N;
     }
+
+    // intersect() solves against the plane N.p = -N.v0, so bound the surface it actually reports hits on
+    void getBounds(Vector3 &bmin, Vector3 &bmax) {
+      Vector3 p0, p1, p2;
+      getTriangle(p0, p1, p2);
+      bmin = Vector3(min(p0.x, min(p1.x, p2.x)), min(p0.y, min(p1.y, p2.y)), min(p0.z, min(p1.z, p2.z)));
+      bmax = Vector3(max(p0.x, max(p1.x, p2.x)), max(p0.y, max(p1.y, p2.y)), max(p0.z, max(p1.z, p2.z)));
+    }
+
+    // The edge tests in intersect() are unchanged by the plane offset, so hits lie exactly inside the offset triangle
+    bool getTriangle(Vector3 &p0, Vector3 &p1, Vector3 &p2) {
+      Vector3 N = getNormal(Vector3());
+      Vector3 offset = N * (-2 * N.dot(v0));
+      p0 = v0 + offset; p1 = v1 + offset; p2 = v2 + offset;
+      return true;
+    }
+
+    // Barycentric interpolation of the vertex uvs, hits are projected back onto the triangle's plane first
+    Vector3 getUV(const Vector3 &hitPoint) {
+      Vector3 N = getNormal(Vector3());
+      Vector3 p = hitPoint - N * N.dot(hitPoint - v0);
+      Vector3 v01 = v1 - v0, v02 = v2 - v0, v0p = p - v0;
+      float area = v01.cross(v02).dot(N);
+      if (fabs(area) < K_EPSILON) return uv0;
+      float b1 = v0p.cross(v02).dot(N) / area;
+      float b2 = v01.cross(v0p).dot(N) / area;
+      return uv0 * (1 - b1 - b2) + uv1 * b1 + uv2 * b2;
+    }
+
+    float getUVScale() {
+      float worldArea = (v1 - v0).cross(v2 - v0).length();
+      float uvArea = (uv1 - uv0).cross(uv2 - uv0).length();
+      return worldArea > 0 ? sqrt(uvArea / worldArea) : 0;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,92 @@
+
+#define SOCKET_READ_SIZE 4096
+#define SOCKET_READ_CHUNKS 16
+
+// Buffered line/byte stream over a connected socket - owns and closes the descriptor
+class SocketStream {
+  public:
+    int fd;
+
+    SocketStream(int _fd) : fd(_fd) {}
+    ~SocketStream() { if (fd >= 0) close(fd); }
+
+    // Read a text line without the newline, returns false once the peer hangs up
+    bool readLine(string &line) {
+      size_t end;
+      while ((end = buffer.find('\n')) == string::npos) {
+        if (!fill()) return false;
+      }
+      line = buffer.substr(0, end);
+      buffer.erase(0, end + 1);
+      return true;
+    }
+
+    bool readBytes(unsigned char *data, size_t size) {
+      while (buffer.size() < size) {
+        if (!fill()) return false;
+      }
+      memcpy(data, buffer.data(), size);
+      buffer.erase(0, size);
+      return true;
+    }
+
+    bool sendAll(const unsigned char *data, size_t size) {
+      while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+      }
+      return true;
+    }
+
+    bool sendAll(const string &message) { return sendAll((const unsigned char *) message.data(), message.size()); }
+
+    // True if data already read from the socket is waiting to be consumed
+    bool buffered() const { return !buffer.empty(); }
+
+    void setNonBlocking() { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK); }
+
+    // Append what has already arrived without waiting, at most SOCKET_READ_CHUNKS reads so a chatty peer can't
+    // starve the caller. Returns false once the peer hangs up or the socket fails
+    bool receiveAvailable() {
+      char chunk[SOCKET_READ_SIZE];
+      for (int i = 0; i < SOCKET_READ_CHUNKS; i++) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n > 0) buffer.append(chunk, n);
+        else if (n < 0 && errno == EINTR) continue;
+        else return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      }
+      return true;
+    }
+
+    // Take a complete line or size bytes from what was already received, false if it hasn't all arrived yet
+    bool takeLine(string &line) {
+      size_t end = buffer.find('\n');
+      if (end == string::npos) return false;
+      line = buffer.substr(0, end);
+      buffer.erase(0, end + 1);
+      return true;
+    }
+
+    bool takeBytes(unsigned char *data, size_t size) {
+      if (buffer.size() < size) return false;
+      memcpy(data, buffer.data(), size);
+      buffer.erase(0, size);
+      return true;
+    }
+
+  private:
+    string buffer;
+
+    SocketStream(const SocketStream &);
+    SocketStream& operator = (const SocketStream &);
+
+    bool fill() {
+      char chunk[SOCKET_READ_SIZE];
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) return false;
+      buffer.append(chunk, n);
+      return true;
+    }
+};
@@ -0,0 +1,314 @@
+
+#define TEXTURE_TILE_SIZE 64
+#define TEXTURE_PAGE_SIZE 4096          // Alignment of tiles in the file
+#define TEXTURE_RELEASE_SIZE 65536      // Granularity pages are released at, covers the kernel's 64 KB fault-around window
+#define TEXTURE_MAX_TILE_SIZE 1024
+#define TEXTURE_MAX_SIZE 65536
+#define TILE_CACHE_SHARDS 16
+
+// Thread safe LRU cache of texture tiles with a fixed memory cap. Split into shards, each with its own lock
+// and an equal share of the cap, so render threads rarely contend.
+class TileCache {
+  public:
+    typedef shared_ptr< vector<unsigned char> > TileData;
+
+    size_t capacity;                    // Bytes
+    atomic<long> hits, misses;
+
+    atomic<size_t> unreleasedBytes;     // Mapped tile bytes madvise failed to release
+
+    TileCache(size_t _capacity) : capacity(_capacity), hits(0), misses(0), unreleasedBytes(0), textures(0), residentBytes(0), peakBytes(0) {}
+
+    int registerTexture() { return textures++; }
+
+    // Fetch a tile, calling load to fill it on a miss. Evicted tiles stay valid for callers still holding them
+    TileData get(uint64_t key, size_t size, const function<void(unsigned char*)> &load) {
+      Shard &shard = shards[key % TILE_CACHE_SHARDS];
+      {
+        lock_guard<mutex> lock(shard.lock);
+        unordered_map<uint64_t, list<Entry>::iterator>::iterator it = shard.index.find(key);
+        if (it != shard.index.end()) {
+          shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+          hits++;
+          return it->second->data;
+        }
+      }
+
+      // Load outside the lock - page faults on the mapped file must not block the shard
+      misses++;
+      TileData data = make_shared< vector<unsigned char> >(size);
+      load(&(*data)[0]);
+
+      lock_guard<mutex> lock(shard.lock);
+      unordered_map<uint64_t, list<Entry>::iterator>::iterator it = shard.index.find(key);
+      if (it != shard.index.end()) return it->second->data;
+
+      Entry entry = { key, data };
+      shard.lru.push_front(entry);
+      shard.index[key] = shard.lru.begin();
+      shard.bytes += size;
+      add(size);
+
+      size_t shardCapacity = capacity / TILE_CACHE_SHARDS;
+      while (shard.bytes > shardCapacity && shard.lru.size() > 1) {
+        Entry &evicted = shard.lru.back();
+        shard.bytes -= evicted.data->size();
+        add(-(long) evicted.data->size());
+        shard.index.erase(evicted.key);
+        shard.lru.pop_back();
+      }
+      return data;
+    }
+
+    size_t resident() const { return residentBytes; }
+    size_t peak() const { return peakBytes; }
+
+    void report() {
+      long total = hits + misses;
+      printf ("Texture cache: %ld lookups, %.1f%% hit rate, %.1f MB resident, %.1f MB peak, %.1f MB cap\n",
+        total, total ? 100.0 * hits / total : 0.0, resident() / 1048576.0, peak() / 1048576.0, capacity / 1048576.0);
+      if (unreleasedBytes > 0)
+        printf ("Texture cache: %.1f MB of mapped tiles could not be released, memory is over the cap\n", unreleasedBytes / 1048576.0);
+    }
+
+  private:
+    struct Entry {
+      uint64_t key;
+      TileData data;
+    };
+
+    struct Shard {
+      mutex lock;
+      list<Entry> lru;                // Most recently used first
+      unordered_map<uint64_t, list<Entry>::iterator> index;
+      size_t bytes;
+      Shard() : bytes(0) {}
+    };
+
+    Shard shards[TILE_CACHE_SHARDS];
+    atomic<int> textures;
+    atomic<size_t> residentBytes, peakBytes;
+
+    void add(long size) {
+      size_t now = residentBytes += size;
+      size_t peak = peakBytes;
+      while (now > peak && !peakBytes.compare_exchange_weak(peak, now)) {}
+    }
+};
+
+// Tiled, mip-mapped RGB8 texture read through mmap. File layout:
+//   header        "RTTX", version, width, height, tileSize, levels
+//   levels        width, height, tilesX, tilesY, offset of the first tile - finest level first
+//   tiles         row-major per level, tileSize * tileSize * 3 bytes padded to TEXTURE_PAGE_SIZE,
+//                 edge tiles are padded to the full tile size
+class Texture {
+  public:
+    int width, height, tileSize, levels;
+
+    Texture(TileCache &_cache) : width(0), height(0), tileSize(0), levels(0), cache(_cache), data(NULL), size(0) {
+      id = cache.registerTexture();
+      systemPageSize = sysconf(_SC_PAGESIZE);
+      if (systemPageSize <= 0) systemPageSize = TEXTURE_PAGE_SIZE;
+      releaseSize = max(systemPageSize, (long) TEXTURE_RELEASE_SIZE);
+    }
+
+    ~Texture() {
+      if (data) munmap((void *) data, size);
+    }
+
+    // Map a texture file - returns false if it is missing, truncated or inconsistent
+    bool open(const string &path) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+      struct stat info;
+      if (fstat(fd, &info) < 0 || info.st_size < TEXTURE_PAGE_SIZE) {
+        close(fd);
+        return false;
+      }
+      void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (mapped == MAP_FAILED) return false;
+      data = (const unsigned char *) mapped;
+      size = info.st_size;
+
+      if (!validate()) {
+        munmap(mapped, size);
+        data = NULL;
+        levels = 0;
+        levelInfo.clear();
+        return false;
+      }
+      return true;
+    }
+
+    // Bilinear sample at the mip level matching a footprint given in uv units
+    Color sample(const Vector3 &uv, float footprint) {
+      if (levels == 0) return Color();
+      float texels = footprint * max(width, height);
+      int level = texels > 1 ? min(levels - 1, (int) floor(log2(texels) + 0.5)) : 0;
+      const Level &l = levelInfo[level];
+
+      float x = (uv.x - floor(uv.x)) * l.width - 0.5;
+      float y = (uv.y - floor(uv.y)) * l.height - 0.5;
+      int x0 = (int) floor(x), y0 = (int) floor(y);
+      float fx = x - x0, fy = y - y0;
+
+      TileLookup lookup;
+      Color c00 = texel(level, x0, y0, lookup), c10 = texel(level, x0 + 1, y0, lookup);
+      Color c01 = texel(level, x0, y0 + 1, lookup), c11 = texel(level, x0 + 1, y0 + 1, lookup);
+      return (c00 * (1 - fx) + c10 * fx) * (1 - fy) + (c01 * (1 - fx) + c11 * fx) * fy;
+    }
+
+    // Write a texture file from an RGB8 image, building the mip chain with a box filter
+    static bool write(const string &path, const unsigned char *rgb, int width, int height, int tileSize = TEXTURE_TILE_SIZE) {
+      Header header = { { 'R', 'T', 'T', 'X' }, 1, (uint32_t) width, (uint32_t) height, (uint32_t) tileSize, 0 };
+      vector<Level> levels;
+      size_t tileStride = roundUp(tileSize * tileSize * 3, TEXTURE_PAGE_SIZE);
+      uint64_t offset = TEXTURE_PAGE_SIZE;
+      for (int w = width, h = height; ; w = max(1, w / 2), h = max(1, h / 2)) {
+        Level level = { (uint32_t) w, (uint32_t) h, (uint32_t) ((w + tileSize - 1) / tileSize), (uint32_t) ((h + tileSize - 1) / tileSize), offset };
+        levels.push_back(level);
+        offset += (uint64_t) level.tilesX * level.tilesY * tileStride;
+        if (w == 1 && h == 1) break;
+      }
+      header.levels = levels.size();
+
+      ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+      if (!out) return false;
+      vector<char> page(TEXTURE_PAGE_SIZE, 0);
+      memcpy(&page[0], &header, sizeof(header));
+      memcpy(&page[sizeof(header)], &levels[0], levels.size() * sizeof(Level));
+      out.write(&page[0], page.size());
+
+      vector<unsigned char> image(rgb, rgb + (size_t) width * height * 3), tile(tileStride);
+      for (int i = 0; i < levels.size(); i++) {
+        const Level &l = levels[i];
+        if (i > 0) image = downsample(image, levels[i - 1].width, levels[i - 1].height, l.width, l.height);
+
+        for (int ty = 0; ty < l.tilesY; ty++) {
+          for (int tx = 0; tx < l.tilesX; tx++) {
+            fill(tile.begin(), tile.end(), 0);
+            for (int y = 0; y < tileSize && ty * tileSize + y < l.height; y++) {
+              int x0 = tx * tileSize, count = min(tileSize, (int) l.width - x0);
+              memcpy(&tile[y * tileSize * 3], &image[((size_t) (ty * tileSize + y) * l.width + x0) * 3], count * 3);
+            }
+            out.write((const char *) &tile[0], tile.size());
+          }
+        }
+      }
+      out.close();
+      return !out.fail();
+    }
+
+  private:
+    struct Header {
+      char magic[4];
+      uint32_t version, width, height, tileSize, levels;
+    };
+
+    struct Level {
+      uint32_t width, height, tilesX, tilesY;
+      uint64_t offset;
+    };
+
+    // Last tile touched by a sample, so the four bilinear taps usually cost one cache lookup
+    struct TileLookup {
+      int tile;
+      TileCache::TileData data;
+      TileLookup() : tile(-1) {}
+    };
+
+    TileCache &cache;
+    int id;
+    const unsigned char *data;
+    size_t size, tileStride;
+    long systemPageSize;
+    long releaseSize;                   // Release granularity, the system page size if that is larger
+    vector<Level> levelInfo;
+
+    // Check every level against the mip chain implied by the header and the size of the mapped file
+    bool validate() {
+      Header header;
+      memcpy(&header, data, sizeof(header));
+      if (memcmp(header.magic, "RTTX", 4) != 0 || header.version != 1) return false;
+      if (header.width == 0 || header.height == 0 || header.width > TEXTURE_MAX_SIZE || header.height > TEXTURE_MAX_SIZE) return false;
+      if (header.tileSize == 0 || header.tileSize > TEXTURE_MAX_TILE_SIZE) return false;
+      if (header.levels == 0 || sizeof(Header) + header.levels * sizeof(Level) > TEXTURE_PAGE_SIZE) return false;
+
+      width = header.width;
+      height = header.height;
+      tileSize = header.tileSize;
+      levels = header.levels;
+      tileStride = roundUp((size_t) tileSize * tileSize * 3, TEXTURE_PAGE_SIZE);
+      levelInfo.resize(levels);
+      memcpy(&levelInfo[0], data + sizeof(Header), levels * sizeof(Level));
+
+      uint32_t w = width, h = height;
+      for (int i = 0; i < levels; i++) {
+        const Level &l = levelInfo[i];
+        if (l.width != w || l.height != h) return false;
+        if (l.tilesX != (w + tileSize - 1) / tileSize || l.tilesY != (h + tileSize - 1) / tileSize) return false;
+        uint64_t tiles = (uint64_t) l.tilesX * l.tilesY;
+        if (l.offset % TEXTURE_PAGE_SIZE != 0 || l.offset > size || tiles > (size - l.offset) / tileStride) return false;
+        if (w == 1 && h == 1) return i == levels - 1;
+        w = max(1u, w / 2);
+        h = max(1u, h / 2);
+      }
+      return true;
+    }
+
+    Color texel(int level, int x, int y, TileLookup &lookup) {
+      const Level &l = levelInfo[level];
+      int w = l.width, h = l.height;
+      x = ((x % w) + w) % w;      // Repeat
+      y = ((y % h) + h) % h;
+
+      int tile = (y / tileSize) * l.tilesX + (x / tileSize);
+      if (tile != lookup.tile) {
+        const unsigned char *source = data + l.offset + (uint64_t) tile * tileStride;
+        size_t tileBytes = (size_t) tileSize * tileSize * 3;
+        uint64_t key = ((uint64_t) id << 40) | ((uint64_t) level << 32) | (uint64_t) tile;
+        lookup.data = cache.get(key, tileBytes, [this, source, tileBytes](unsigned char *out) {
+          memcpy(out, source, tileBytes);
+          release(source, tileStride);
+        });
+        lookup.tile = tile;
+      }
+
+      const unsigned char *p = &(*lookup.data)[((y % tileSize) * tileSize + (x % tileSize)) * 3];
+      return Color(p[0], p[1], p[2]);
+    }
+
+    // The copy is now resident in the cache, let the kernel drop the mapped pages. A fault maps the whole aligned
+    // window around it, so release at that size, clamped to this file's mapping - MADV_DONTNEED on neighbouring
+    // memory would zero it. Other tiles in the window are read only file pages and just fault back in
+    void release(const unsigned char *source, size_t length) {
+      uintptr_t mapStart = (uintptr_t) data, mapEnd = roundUp((uintptr_t) data + size, systemPageSize);
+      uintptr_t start = max(mapStart, (uintptr_t) source / releaseSize * releaseSize);
+      uintptr_t end = min(mapEnd, roundUp((uintptr_t) source + length, releaseSize));
+      assert(start % systemPageSize == 0 && start < end && end <= mapEnd);
+      if (madvise((void *) start, end - start, MADV_DONTNEED) != 0)
+        cache.unreleasedBytes += length;
+    }
+
+    Texture(const Texture &);
+    Texture& operator = (const Texture &);
+
+    static size_t roundUp(size_t n, size_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+
+    static vector<unsigned char> downsample(const vector<unsigned char> &image, int width, int height, int w, int h) {
+      vector<unsigned char> out((size_t) w * h * 3);
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          for (int c = 0; c < 3; c++) {
+            int sum = 0;
+            for (int dy = 0; dy < 2; dy++)
+              for (int dx = 0; dx < 2; dx++)
+                sum += image[((size_t) min(height - 1, y * 2 + dy) * width + min(width - 1, x * 2 + dx)) * 3 + c];
+            out[((size_t) y * w + x) * 3 + c] = (unsigned char) ((sum + 2) / 4);
+          }
+        }
+      }
+      return out;
+    }
+};
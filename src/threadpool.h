@@ -0,0 +1,78 @@
+
+// Shared worker pool - tasks run highest priority first, then in submission order
+class ThreadPool {
+  public:
+    struct Task {
+      int priority;
+      long order;
+      int job;                  // Owning job, used for cancellation
+      function<void()> run;
+      bool operator < (const Task &t) const {
+        return priority != t.priority ? priority < t.priority : order > t.order;
+      }
+    };
+
+    ThreadPool(int threadCount = 0) : stopping(false), submitted(0) {
+      if (threadCount <= 0) threadCount = max(1, (int) thread::hardware_concurrency());
+      for (int i = 0; i < threadCount; i++)
+        workers.push_back(thread([this]() { work(); }));
+    }
+
+    ~ThreadPool() {
+      {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+      }
+      available.notify_all();
+      for (int i = 0; i < workers.size(); i++)
+        workers[i].join();
+    }
+
+    void submit(int job, int priority, function<void()> run) {
+      {
+        lock_guard<mutex> lock(queueMutex);
+        Task task = { priority, submitted++, job, run };
+        tasks.push(task);
+      }
+      available.notify_one();
+    }
+
+    // Drop queued tasks of a job - tasks already running are left to finish
+    int cancel(int job) {
+      lock_guard<mutex> lock(queueMutex);
+      vector<Task> keep;
+      int dropped = 0;
+      while (!tasks.empty()) {
+        if (tasks.top().job == job) dropped++;
+        else keep.push_back(tasks.top());
+        tasks.pop();
+      }
+      for (int i = 0; i < keep.size(); i++)
+        tasks.push(keep[i]);
+      return dropped;
+    }
+
+    int size() const { return workers.size(); }
+
+  private:
+    vector<thread> workers;
+    priority_queue<Task> tasks;
+    mutex queueMutex;
+    condition_variable available;
+    bool stopping;
+    long submitted;
+
+    void work() {
+      while (true) {
+        Task task;
+        {
+          unique_lock<mutex> lock(queueMutex);
+          available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+          if (stopping && tasks.empty()) return;
+          task = tasks.top();
+          tasks.pop();
+        }
+        task.run();
+      }
+    }
+};
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <random>
+#include <thread>
 using namespace std;
 
 class Vector3 {
@@ -60,10 +62,15 @@ class Vector3 {
       return os;
     }
 
+    // Per-thread generator so render threads don't contend on rand()'s global state. Seeds are a fixed base plus
+    // the order threads first draw in, so single threaded renders are reproducible from run to run
     static Vector3 random() {
-      float rx = ((float) rand() / (RAND_MAX));
-      float ry = ((float) rand() / (RAND_MAX));
-      float rz = ((float) rand() / (RAND_MAX));
+      static atomic<unsigned> nextSeed(5489u);
+      static thread_local mt19937 generator(nextSeed++);
+      static thread_local uniform_real_distribution<float> distribution(0.0, 1.0);
+      float rx = distribution(generator);
+      float ry = distribution(generator);
+      float rz = distribution(generator);
       return Vector3(rx, ry, rz);
     }
 